@@ -0,0 +1,76 @@
+#!/bin/sh
+# usage: compare.sh [--record] <serial output> <baseline>
+# picks the "BENCH <name> <us>" lines out of the serial output of the benchmark kernel.
+# without --record, fails if there is no baseline, if a workload of the baseline is missing from the results, or if any
+# workload got slower than its baseline by more than BENCH_TOLERANCE percent. QEMU runs with -icount, so the numbers are
+# instruction counts and don't jitter, hence the tight default of 2.
+# with --record, writes the results as the new baseline instead.
+
+record=0
+if [ "$1" = "--record" ]; then
+    record=1
+    shift
+fi
+
+out="$1"
+baseline="$2"
+tolerance="${BENCH_TOLERANCE:-2}"
+
+if [ ! -f "$out" ] || ! grep -q "^BENCH_DONE" "$out"; then
+    echo "bench: no BENCH_DONE in $out, the kernel crashed, hung or was never run" >&2
+    exit 1
+fi
+
+if grep -q "^BENCH_ERROR" "$out"; then
+    grep "^BENCH_ERROR" "$out" >&2
+    exit 1
+fi
+
+# serial output comes with \r\n line endings
+results=$(tr -d '\r' < "$out" | awk '$1 == "BENCH" && NF == 3 { print $2, $3 }')
+
+if [ "$record" = 1 ]; then
+    echo "$results" > "$baseline"
+    echo "bench: baseline written to $baseline"
+    exit 0
+fi
+
+if [ ! -f "$baseline" ]; then
+    echo "$results" | awk '{ printf "%-20s %10d us\n", $1, $2 }'
+    echo "bench: no baseline at $baseline, run 'make bench-baseline' to record one" >&2
+    exit 1
+fi
+
+echo "$results" | awk -v baseline="$baseline" -v tolerance="$tolerance" '
+    BEGIN {
+        while ((getline line < baseline) > 0) {
+            split(line, f, " ")
+            base[f[1]] = f[2]
+        }
+    }
+    {
+        seen[$1] = 1
+        if (!($1 in base)) {
+            printf "%-20s %10d us  (new)\n", $1, $2
+            next
+        }
+        change = base[$1] ? ($2 - base[$1]) * 100 / base[$1] : ($2 ? 100 : 0)
+        status = change > tolerance ? "REGRESSION" : "ok"
+        if (change > tolerance)
+            failed++
+        printf "%-20s %10d us  baseline %10d us  %+6.1f%%  %s\n", $1, $2, base[$1], change, status
+    }
+    END {
+        for (name in base) {
+            if (!(name in seen)) {
+                printf "%-20s %10s     baseline %10d us           MISSING\n", name, "-", base[name]
+                missing++
+            }
+        }
+        if (failed)
+            printf "bench: %d workload(s) regressed by more than %s%%\n", failed, tolerance
+        if (missing)
+            printf "bench: %d workload(s) of the baseline are missing from the results\n", missing
+        if (failed || missing)
+            exit 1
+    }'
@@ -0,0 +1,9 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// only built into the kernel when compiled with -D BENCHMARK (see "make bench").
+// runs a fixed workload suite and reports one "BENCH <name> <microseconds>" line per workload over the UART,
+// followed by "BENCH_DONE", then asks QEMU to exit through semihosting.
+void bench_run(void);
+
+#endif
@@ -25,7 +25,18 @@
  *      gets the first element from the list without removing it
  *
  * struct nodeType * pop_nodeType_list(nodeType_list_t * list)
- *      gets the first element from the list and removes it
+ *      gets the first element from the list and removes it, null if the list is empty
+ *
+ * void remove_nodeType_list(nodeType_list_t * list, struct nodeType * node)
+ *      removes the node from anywhere in the list in O(1), node must be in that list
+ *
+ * void splice_nodeType_list(nodeType_list_t * dest, nodeType_list_t * src)
+ *      moves every element of src to the back of dest in O(1), src is left empty
+ *
+ * uint32_t detach_nodeType_list(nodeType_list_t * list, uint32_t count, nodeType_list_t * front)
+ *      moves the first count elements of list into front as one chain, or all of them if list holds fewer.
+ *      walks count nodes to find where to cut, every other list operation is done once. front's old content is dropped,
+ *      returns the number of elements moved
  *
  * uint32_t size_nodeType_list(nodeType_list_t * list)
  *      returns the number of elements in the list
@@ -64,7 +75,9 @@ struct nodeType * prev##nodeType;
 
 #define IMPLEMENT_LIST(nodeType) \
 void append_##nodeType##_list(nodeType##_list_t * list, struct nodeType * node) {  \
-    list->tail->next##nodeType = node;                                       \
+    if (list->tail != NULL) {                                                \
+        list->tail->next##nodeType = node;                                   \
+    }                                                                        \
     node->prev##nodeType = list->tail;                                       \
     list->tail = node;                                                       \
     node->next##nodeType = NULL;                                             \
@@ -77,6 +90,9 @@ void append_##nodeType##_list(nodeType##_list_t * list, struct nodeType * node)
 void push_##nodeType##_list(nodeType##_list_t * list, struct nodeType * node) {    \
     node->next##nodeType = list->head;                                       \
     node->prev##nodeType = NULL;                                             \
+    if (list->head != NULL) {                                                \
+        list->head->prev##nodeType = node;                                   \
+    }                                                                        \
     list->head = node;                                                       \
     list->size += 1;                                                         \
     if (list->tail == NULL) {                                                \
@@ -90,15 +106,77 @@ struct nodeType * peek_##nodeType##_list(nodeType##_list_t * list) {         \
                                                                              \
 struct nodeType * pop_##nodeType##_list(nodeType##_list_t * list) {          \
     struct nodeType * res = list->head;                                      \
-    list->head = list->head->next##nodeType;                                 \
-    list->head->prev##nodeType = NULL;                                                 \
+    if (res == NULL) {                                                       \
+        return NULL;                                                         \
+    }                                                                        \
+    list->head = res->next##nodeType;                                        \
     list->size -= 1;                                                         \
     if (list->head == NULL) {                                                \
-        list->tail = NULL;                                                  \
+        list->tail = NULL;                                                   \
+    } else {                                                                 \
+        list->head->prev##nodeType = NULL;                                   \
     }                                                                        \
     return res;                                                              \
 }                                                                            \
                                                                              \
+void remove_##nodeType##_list(nodeType##_list_t * list, struct nodeType * node) { \
+    if (node->prev##nodeType != NULL) {                                      \
+        node->prev##nodeType->next##nodeType = node->next##nodeType;         \
+    } else {                                                                 \
+        list->head = node->next##nodeType;                                   \
+    }                                                                        \
+    if (node->next##nodeType != NULL) {                                      \
+        node->next##nodeType->prev##nodeType = node->prev##nodeType;         \
+    } else {                                                                 \
+        list->tail = node->prev##nodeType;                                   \
+    }                                                                        \
+    node->next##nodeType = node->prev##nodeType = NULL;                      \
+    list->size -= 1;                                                         \
+}                                                                            \
+                                                                             \
+void splice_##nodeType##_list(nodeType##_list_t * dest, nodeType##_list_t * src) { \
+    if (src->head == NULL) {                                                 \
+        return;                                                              \
+    }                                                                        \
+    if (dest->tail != NULL) {                                                \
+        dest->tail->next##nodeType = src->head;                              \
+        src->head->prev##nodeType = dest->tail;                              \
+    } else {                                                                 \
+        dest->head = src->head;                                              \
+    }                                                                        \
+    dest->tail = src->tail;                                                  \
+    dest->size += src->size;                                                 \
+    src->head = src->tail = NULL;                                            \
+    src->size = 0;                                                           \
+}                                                                            \
+                                                                             \
+uint32_t detach_##nodeType##_list(nodeType##_list_t * list, uint32_t count, nodeType##_list_t * front) { \
+    struct nodeType * last = list->head;                                     \
+    uint32_t i;                                                              \
+    if (count >= list->size) {                                               \
+        *front = *list;                                                      \
+        list->head = list->tail = NULL;                                      \
+        list->size = 0;                                                      \
+        return front->size;                                                  \
+    }                                                                        \
+    front->head = front->tail = NULL;                                        \
+    front->size = 0;                                                         \
+    if (count == 0) {                                                        \
+        return 0;                                                            \
+    }                                                                        \
+    for (i = 1; i < count; i++) {                                            \
+        last = last->next##nodeType;                                         \
+    }                                                                        \
+    front->head = list->head;                                                \
+    front->tail = last;                                                      \
+    front->size = count;                                                     \
+    list->head = last->next##nodeType;                                       \
+    list->head->prev##nodeType = NULL;                                       \
+    list->size -= count;                                                     \
+    last->next##nodeType = NULL;                                             \
+    return count;                                                            \
+}                                                                            \
+                                                                             \
 uint32_t size_##nodeType##_list(nodeType##_list_t * list) {                  \
     return list->size;                                                       \
 }                                                                            \
@@ -29,6 +29,48 @@ void mem_init(atag_t *atags);
 void *alloc_page(void);
 void free_page(void *ptr);
 
+// get/give back n pages at once, the free list is only touched once per call.
+// alloc_pages_bulk is all or nothing: returns n with the pages written to out[], or 0 if there aren't enough free pages
+uint32_t alloc_pages_bulk(uint32_t n, void **out);
+void free_pages_bulk(uint32_t n, void **pages);
+
+// n physically contiguous pages, the first one aligned to align bytes(a power of 2, anything up to PAGE_SIZE means page aligned).
+// this scans the page array, so it is meant for the odd big table, not for hot paths. Returns NULL if there is no such run
+void *alloc_pages_contiguous(uint32_t n, uint32_t align);
+void free_pages_contiguous(void *ptr, uint32_t n);
+
 void *kmalloc(uint32_t bytes);
 void kfree(void *ptr);
+
+// reclaimers(caches, pools...) give pages back under pressure: reclaim() gets the pages wanted, returns the pages freed.
+// below the low watermark mem_reclaim_background() runs from the idle loop up to the high one, and a failing page
+// allocation gets one synchronous pass first. The kmalloc heap doesn't come from free pages, so it isn't reclaimable.
+// unregistering twice or from inside reclaim() is fine, so is one never registered as long as it was zero initialized.
+typedef struct reclaimer {
+	uint32_t (*reclaim)(uint32_t pages_wanted, void *data);
+	void *data;
+	DEFINE_LINK(reclaimer);
+} reclaimer_t;
+
+void mem_register_reclaimer(reclaimer_t *reclaimer);
+void mem_unregister_reclaimer(reclaimer_t *reclaimer);
+void mem_set_watermarks(uint32_t low, uint32_t high);
+uint32_t mem_free_pages(void);
+void mem_reclaim_background(void);
+
+// arena(region) allocator for allocations sharing one lifetime, e.g. per-request scratch data or boot-time tables.
+// memory is bump-allocated from pages of alloc_page(), objects have no header and can't be freed one by one,
+// everything is given back at once by arena_reset()/arena_destroy().
+// allocations that don't fit in one page, or ask for page alignment or more(e.g. a 16KB aligned L1 page table),
+// get a run of contiguous pages of their own from alloc_pages_contiguous().
+// arena_high_water() is the peak of bytes handed out, arena_peak_pages() the peak of pages the arena really held,
+// headers and the wasted tails of chunks included. The latter is the one to size an arena with.
+typedef struct arena arena_t;
+
+arena_t *arena_create(void);
+void *arena_alloc(arena_t *arena, uint32_t size, uint32_t align);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
+uint32_t arena_high_water(arena_t *arena);
+uint32_t arena_peak_pages(arena_t *arena);
 #endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef UART_H
+#define UART_H
+
+// implemented in kernel.c
+void uart_init();
+void uart_putc(unsigned char c);
+unsigned char uart_getc();
+void uart_puts(const char* str);
+
+#endif
@@ -1,13 +1,18 @@
 #include <kernel/atags.h>
+#include <stddef.h>
 
 // VM does not emulate the bootloader which sets up the atags.
 // So this would not work on VM
+// returns 0 when there is no atag list at all
 uint32_t get_mem_size(atag_t * tag) {
+   if (tag == NULL || tag->tag != CORE) {
+       return 0;
+   }
    while (tag->tag != NONE) {
        if (tag->tag == MEM) {
            return tag->mem.size;
        }
-       tag = ((uint32_t *)tag) + tag->tag_size;
+       tag = (atag_t *)(((uint32_t *)tag) + tag->tag_size);
    }
    return 0;
 
@@ -0,0 +1,185 @@
+#ifdef BENCHMARK
+#include <kernel/bench.h>
+#include <kernel/mem.h>
+#include <kernel/uart.h>
+#include <kernel/atags.h>
+#include <common/stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// BCM2835 system timer, a free running 1MHz counter. CLO holds its lower 32 bits
+#define SYSTIMER_CLO 0x3F003004 // for raspi2 & 3, 0x20003004 for raspi1
+
+#define CHURN_ROUNDS 200
+#define CHURN_SLOTS 64
+#define PAGE_ROUNDS 8192
+#define BULK_PAGES 32
+#define COPY_BYTES (64 * 1024)
+#define COPY_ROUNDS 16
+#define UART_BYTES 4096
+#define RECLAIM_PAGES 256
+
+static uint8_t copy_src[COPY_BYTES];
+static uint8_t copy_dst[COPY_BYTES];
+
+static void *reclaim_pool[RECLAIM_PAGES];
+static uint32_t reclaim_pool_size;
+
+static inline uint32_t timer_read(void) {
+    return *(volatile uint32_t *)SYSTIMER_CLO;
+}
+
+static void bench_print(const char *name, uint32_t value) {
+    uart_puts("BENCH ");
+    uart_puts(name);
+    uart_puts(" ");
+    uart_puts(itoa(value));
+    uart_puts("\r\n");
+}
+
+static void bench_report(const char *name, uint32_t start) {
+    bench_print(name, timer_read() - start);
+}
+
+// every page handed out gets zeroed, which costs far more than the free list operations themselves.
+// page workloads take this off their time so a regression in the list handling isn't drowned in bzero
+static uint32_t page_zero_time(uint32_t pages) {
+    uint32_t start, i;
+
+    start = timer_read();
+    for (i = 0; i < pages; i++)
+        bzero(copy_dst, PAGE_SIZE);
+    return timer_read() - start;
+}
+
+static void bench_report_pages(const char *name, uint32_t start, uint32_t zero_time) {
+    uint32_t elapsed = timer_read() - start;
+
+    bench_print(name, elapsed > zero_time ? elapsed - zero_time : 0);
+}
+
+// kmalloc/kfree a set of slots with mixed sizes, freeing in a different order than allocating to exercise coalescing
+static void bench_alloc_churn(void) {
+    void *slots[CHURN_SLOTS];
+    uint32_t start, round, i;
+
+    start = timer_read();
+    for (round = 0; round < CHURN_ROUNDS; round++) {
+        for (i = 0; i < CHURN_SLOTS; i++)
+            slots[i] = kmalloc(16 + ((i * 37 + round) % 512));
+        for (i = 0; i < CHURN_SLOTS; i += 2)
+            kfree(slots[i]);
+        for (i = 1; i < CHURN_SLOTS; i += 2)
+            kfree(slots[i]);
+    }
+    bench_report("alloc_churn", start);
+}
+
+static void bench_page_alloc(void) {
+    void *pages[BULK_PAGES];
+    uint32_t start, round, i, zero_time;
+
+    // all three workloads below zero PAGE_ROUNDS pages
+    zero_time = page_zero_time(PAGE_ROUNDS);
+    bench_print("page_zero", zero_time);
+
+    start = timer_read();
+    for (round = 0; round < PAGE_ROUNDS; round++)
+        free_page(alloc_page());
+    bench_report_pages("page_alloc", start, zero_time);
+
+    start = timer_read();
+    for (round = 0; round < PAGE_ROUNDS / BULK_PAGES; round++) {
+        for (i = 0; i < BULK_PAGES; i++)
+            pages[i] = alloc_page();
+        for (i = 0; i < BULK_PAGES; i++)
+            free_page(pages[i]);
+    }
+    bench_report_pages("page_alloc_many", start, zero_time);
+
+    start = timer_read();
+    for (round = 0; round < PAGE_ROUNDS / BULK_PAGES; round++) {
+        alloc_pages_bulk(BULK_PAGES, pages);
+        free_pages_bulk(BULK_PAGES, pages);
+    }
+    bench_report_pages("page_alloc_bulk", start, zero_time);
+}
+
+static void bench_memcpy_bzero(void) {
+    uint32_t start, round;
+
+    start = timer_read();
+    for (round = 0; round < COPY_ROUNDS; round++)
+        memcpy(copy_dst, copy_src, COPY_BYTES);
+    bench_report("memcpy_1MB", start);
+
+    start = timer_read();
+    for (round = 0; round < COPY_ROUNDS; round++)
+        bzero(copy_dst, COPY_BYTES);
+    bench_report("bzero_1MB", start);
+}
+
+// the bytes sent here show up in the serial output as well, they are on their own lines so the parser skips them
+static void bench_uart(void) {
+    uint32_t start, i;
+
+    start = timer_read();
+    for (i = 0; i < UART_BYTES; i++)
+        uart_putc(i % 64 == 63 ? '\n' : '.');
+    bench_report("uart_4KB", start);
+}
+
+// stands in for a cache, gives its pages back one by one
+static uint32_t bench_pool_reclaim(uint32_t pages_wanted, void *data) {
+    uint32_t freed = 0;
+
+    (void) data;
+    while (freed < pages_wanted && reclaim_pool_size > 0) {
+        free_page(reclaim_pool[--reclaim_pool_size]);
+        freed++;
+    }
+    return freed;
+}
+
+// drop below the low watermark with a pool holding pages, then let the background pass bring free pages back to the high one
+static void bench_reclaim(void) {
+    reclaimer_t pool = { .reclaim = bench_pool_reclaim };
+    uint32_t start, free;
+
+    reclaim_pool_size = alloc_pages_bulk(RECLAIM_PAGES, reclaim_pool);
+    mem_register_reclaimer(&pool);
+
+    free = mem_free_pages();
+    start = timer_read();
+    mem_set_watermarks(free + 1, free + RECLAIM_PAGES);
+    mem_reclaim_background();
+    bench_report("reclaim_256", start);
+
+    if (reclaim_pool_size != 0 || mem_free_pages() != free + RECLAIM_PAGES)
+        uart_puts("BENCH_ERROR reclaim did not give the pool back\r\n");
+
+    // pool lives on this stack frame, and the watermarks above only made sense for it
+    mem_unregister_reclaimer(&pool);
+    mem_set_watermarks(0, 0);
+}
+
+// semihosting SYS_EXIT(0x18) with ADP_Stopped_ApplicationExit(0x20026), QEMU quits when started with -semihosting
+static void bench_exit(void) {
+    asm volatile("mov r0, #0x18\n"
+                 "ldr r1, =0x20026\n"
+                 "svc 0x00123456\n"
+                 : : : "r0", "r1", "memory");
+}
+
+void bench_run(void) {
+    uart_puts("BENCH_START\r\n");
+    bench_alloc_churn();
+    bench_page_alloc();
+    bench_memcpy_bzero();
+    bench_uart();
+    bench_reclaim();
+    uart_puts("BENCH_DONE\r\n");
+
+    bench_exit();
+}
+#endif
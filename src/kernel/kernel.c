@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <kernel/uart.h>
+#include <kernel/mem.h>
+#include <kernel/bench.h>
 
 static inline void mmio_write(uint32_t reg, uint32_t data){ //MMIO(Memory Mapped IO) : all interactions with hardware on the Raspberry Pi occur using MMIO.
     //vollatile: get the variable from memory directly, instead from register(which may resulted from compiler optimization)
@@ -136,12 +139,20 @@ void kernel_main(uint32_t r0, uint32_t r1, uint32_t atags)
 {
     (void) r0;
     (void) r1;
-    (void) atags;
-
     uart_init();
     uart_puts("Hello, kernel World!\r\n");
 
+    mem_init((atag_t *)atags);
+
+#ifdef BENCHMARK
+    // "make bench" builds a separate image that only runs the benchmark suite
+    bench_run();
+#endif
+
     while (1) {
+        // while the receive FIFO is empty, the idle time goes to reclaim flagged by the page allocator
+        while (mmio_read(UART0_FR) & (1 << 4))
+            mem_reclaim_background();
         uart_putc(uart_getc());
         uart_putc('\n');
     }
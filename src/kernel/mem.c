@@ -1,11 +1,12 @@
 #include <kernel/mem.h>
 #include <kernel/atags.h>
+#include <kernel/uart.h>
 #include <common/stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
 
 /*** Heap Stuff******/
-static void heap_init(uint32_t heap_start);
+static void heap_init(uint32_t heap_start, uint32_t heap_size);
 /**
  * impliment kmalloc as a linked list of allocated segments.
  * Segments should be 4 byte aligned.
@@ -22,11 +23,49 @@ static heap_segment_t *heap_segment_list_head;
 
 /*** End Heap Stuff****/
 
+/*** Arena Stuff******/
+/**
+ * every chunk of an arena is a single page from alloc_page(), with this header at the start of it.
+ * chunks are kept newest first, so the one we are bumping from is always the head.
+ */
+typedef struct arena_chunk {
+    struct arena_chunk * next;
+} arena_chunk_t;
+
+/**
+ * allocations that don't fit in a page chunk, or want page alignment or more, get a run of contiguous pages of their own.
+ * the header sits in the last bytes of the run so the data can start right at its aligned beginning.
+ */
+typedef struct arena_large {
+    struct arena_large * next;
+    void * base;
+    uint32_t pages;
+} arena_large_t;
+
+// lives in the first chunk, right after its header, so creating an arena costs exactly one page
+struct arena {
+    arena_chunk_t * chunks;
+    arena_large_t * large;
+    uint32_t offset;        // next free byte in the head chunk, relative to the start of the page
+    uint32_t used;          // bytes handed out since create/reset, alignment padding included
+    uint32_t high_water;    // largest "used" ever seen
+    uint32_t pages;         // pages held right now, chunks and large runs together
+    uint32_t peak_pages;    // largest "pages" ever seen, headers and wasted chunk tails included
+};
+
+static void *arena_alloc_large(arena_t *arena, uint32_t size, uint32_t align);
+
+/*** End Arena Stuff****/
+
 
 // reserve a large swath of memory just after the kernel image for an array of page metadata.
 // We can get this address by using the symbol __end that we declared in the linker script. 
 extern uint8_t __end;
 
+// VM does not emulate the bootloader which sets up the atags, assume this much memory when there are none.
+// kept well below the peripherals at 0x3F000000
+#define DEFAULT_MEM_SIZE (128 * 1024 * 1024)
+
 static uint32_t num_pages;
 
 // after following 2 lines, we can now declare list with type "page_t"
@@ -36,6 +75,20 @@ IMPLEMENT_LIST(page);
 static page_t *all_pages_array;
 page_list_t free_pages;
 
+/*** Reclaim Stuff******/
+DEFINE_LIST(reclaimer);
+IMPLEMENT_LIST(reclaimer);
+
+static reclaimer_list_t reclaimers;
+static uint32_t low_watermark, high_watermark;
+static uint32_t reclaim_pending;
+static uint32_t reclaiming;     // reclaimers free memory, they must not start another reclaim from inside one
+
+static uint32_t reclaim_pass(uint32_t pages_wanted);
+static void check_watermark(void);
+
+/*** End Reclaim Stuff****/
+
 /**
  * impliment kmalloc as a linked list of allocated segments.
  * Segments should be 4 byte aligned.
@@ -43,10 +96,12 @@ page_list_t free_pages;
  */
 
 void mem_init(atag_t *atags) {
-    uint32_t mem_size,  page_array_len, kernel_pages, i;
+    uint32_t mem_size,  page_array_len, kernel_pages, heap_size, i;
 
     // Get the total number of pages
     mem_size = get_mem_size(atags);
+    if (mem_size == 0)
+        mem_size = DEFAULT_MEM_SIZE;
     num_pages = mem_size / PAGE_SIZE;
 
     // Allocate space for all those pages' metadata.  Start this block just after the kernel image is finished
@@ -56,8 +111,8 @@ void mem_init(atag_t *atags) {
     bzero(all_pages_array, page_array_len);
 
     // Iterate over all pages and mark them with the appropriate flags
-    // Start with kernel pages
-    kernel_pages = ((uint32_t)&__end) / PAGE_SIZE;
+    // Start with kernel pages, the metadata array we just put after the kernel image counts as one of them
+    kernel_pages = ((uint32_t)&__end + page_array_len + PAGE_SIZE - 1) / PAGE_SIZE;
     for (i = 0; i < kernel_pages; i++) {
         // set the virtual address mapped to physical page, starting from 0
         all_pages_array[i].vaddr_mapped = i * PAGE_SIZE;    // Identity map the kernel pages
@@ -65,6 +120,15 @@ void mem_init(atag_t *atags) {
         all_pages_array[i].flags.kernel_page = 1;
     }
 
+    // Reserve the pages right after that for the kernel heap, as far as memory goes
+    for (; i < kernel_pages + (KERNEL_HEAP_SIZE / PAGE_SIZE) && i < num_pages; i++) {
+        all_pages_array[i].vaddr_mapped = i * PAGE_SIZE;
+        all_pages_array[i].flags.allocated = 1;
+        all_pages_array[i].flags.kernel_page = 1;
+    }
+    // the end of memory may have cut that short, only hand the heap what it really got
+    heap_size = i > kernel_pages ? (i - kernel_pages) * PAGE_SIZE : 0;
+
     INITIALIZE_LIST(free_pages);
     // Map the rest of the pages as unallocated, and add them to the free list
     for(; i < num_pages; i++){
@@ -72,6 +136,12 @@ void mem_init(atag_t *atags) {
         append_page_list(&free_pages, &all_pages_array[i]);
     }
 
+    heap_init(kernel_pages * PAGE_SIZE, heap_size);
+
+    // start reclaiming once less than 1/64 of the free memory is left, stop at twice that
+    INITIALIZE_LIST(reclaimers);
+    low_watermark = size_page_list(&free_pages) / 64;
+    high_watermark = low_watermark * 2;
 }
 
 void *alloc_page(void) {
@@ -79,11 +149,18 @@ void *alloc_page(void) {
     void *page_mem;
 
 
-    if (size_page_list(&free_pages) == 0)
-        return 0;
+    // last chance before failing
+    if (size_page_list(&free_pages) == 0) {
+        reclaim_pass(1);
+        if (size_page_list(&free_pages) == 0) {
+            uart_puts("mem: out of pages\r\n");
+            return 0;
+        }
+    }
 
     // Get a free page
     page = pop_page_list(&free_pages);
+    check_watermark();
     page->flags.kernel_page = 1;
     page->flags.allocated = 1;
 
@@ -107,13 +184,134 @@ void free_page(void *ptr) {
     append_page_list(&free_pages, page);
 }
 
-static void heap_init(uint32_t heap_start) {
+uint32_t alloc_pages_bulk(uint32_t n, void **out) {
+    page_t *page;
+    page_list_t taken;
+    uint32_t i;
+
+    if (n == 0)
+        return 0;
+
+    if (size_page_list(&free_pages) < n) {
+        reclaim_pass(n - size_page_list(&free_pages));
+        if (size_page_list(&free_pages) < n) {
+            uart_puts("mem: out of pages\r\n");
+            return 0;
+        }
+    }
+
+    // take the first n free pages off the free list as a single chain, then hand them out from that chain
+    detach_page_list(&free_pages, n, &taken);
+    check_watermark();
+
+    for (page = peek_page_list(&taken), i = 0; page != NULL; page = next_page_list(page), i++) {
+        page->flags.kernel_page = 1;
+        page->flags.allocated = 1;
+        out[i] = (void *)((page - all_pages_array) * PAGE_SIZE);
+        bzero(out[i], PAGE_SIZE);
+    }
+
+    return n;
+}
+
+void free_pages_bulk(uint32_t n, void **pages) {
+    page_t *page;
+    page_list_t freed;
+    uint32_t i;
+
+    // chain the pages up locally first, then hand the whole chain back in one go
+    INITIALIZE_LIST(freed);
+    for (i = 0; i < n; i++) {
+        page = all_pages_array + ((uint32_t)pages[i] / PAGE_SIZE);
+        page->flags.allocated = 0;
+        append_page_list(&freed, page);
+    }
+    splice_page_list(&free_pages, &freed);
+}
+
+// first index of n free pages in a row, starting on a multiple of step. num_pages if there is none
+static uint32_t find_free_run(uint32_t n, uint32_t step) {
+    uint32_t first = 0, i;
+
+    while (first + n <= num_pages) {
+        for (i = 0; i < n && !all_pages_array[first + i].flags.allocated; i++);
+        if (i == n)
+            return first;
+        // no run can start before the page right after the allocated one
+        first = (first + i + 1 + step - 1) / step * step;
+    }
+    return num_pages;
+}
+
+void *alloc_pages_contiguous(uint32_t n, uint32_t align) {
+    uint32_t step, first, i;
+    void *mem;
+
+    if (n == 0 || n > num_pages)
+        return NULL;
+    step = align > PAGE_SIZE ? align / PAGE_SIZE : 1;
+
+    first = find_free_run(n, step);
+    if (first == num_pages) {
+        // last chance before failing, reclaimed pages may or may not end up next to each other
+        reclaim_pass(n);
+        first = find_free_run(n, step);
+        if (first == num_pages) {
+            uart_puts("mem: no contiguous pages\r\n");
+            return NULL;
+        }
+    }
+
+    for (i = first; i < first + n; i++) {
+        remove_page_list(&free_pages, &all_pages_array[i]);
+        all_pages_array[i].flags.kernel_page = 1;
+        all_pages_array[i].flags.allocated = 1;
+    }
+    check_watermark();
+
+    mem = (void *)(first * PAGE_SIZE);
+    bzero(mem, n * PAGE_SIZE);
+    return mem;
+}
+
+void free_pages_contiguous(void *ptr, uint32_t n) {
+    page_t *page;
+    page_list_t freed;
+    uint32_t i;
+
+    INITIALIZE_LIST(freed);
+    page = all_pages_array + ((uint32_t)ptr / PAGE_SIZE);
+    for (i = 0; i < n; i++) {
+        page[i].flags.allocated = 0;
+        append_page_list(&freed, &page[i]);
+    }
+    splice_page_list(&free_pages, &freed);
+}
+
+static void heap_init(uint32_t heap_start, uint32_t heap_size) {
+   // no room for even one segment, kmalloc will just fail
+   if (heap_size <= sizeof(heap_segment_t)) {
+       heap_segment_list_head = NULL;
+       return;
+   }
    heap_segment_list_head = (heap_segment_t *) heap_start;
    bzero(heap_segment_list_head, sizeof(heap_segment_t));
-   heap_segment_list_head->segment_size = KERNEL_HEAP_SIZE;
+   heap_segment_list_head->segment_size = heap_size;
 }
  
+static void *heap_alloc(uint32_t bytes);
+
 void *kmalloc(uint32_t bytes) {
+    void *ptr;
+
+    // the heap is a fixed carve-out that never takes pages from the free list, so reclaiming pages can't help it
+    ptr = heap_alloc(bytes);
+    if (ptr == NULL)
+        uart_puts("mem: out of heap\r\n");
+    return ptr;
+}
+
+static void *heap_alloc(uint32_t bytes) {
     heap_segment_t *curr, *best = NULL;
     int diff, best_diff = 0x7fffffff; // Max signed int
 
@@ -143,6 +341,8 @@ void *kmalloc(uint32_t bytes) {
         best->next = ((void*)(best)) + bytes;
         best->next->next = curr;
         best->next->prev = best;
+        if (curr != NULL)
+            curr->prev = best->next;
         best->next->segment_size = best->segment_size - bytes;
         best->segment_size = bytes;
     }
@@ -165,14 +365,202 @@ void kfree(void *ptr) {
     // try to coalesce segements to the left
     while(seg->prev != NULL && !seg->prev->is_allocated) {
         seg->prev->next = seg->next;
-        seg->next->prev = seg->prev;
+        if (seg->next != NULL)
+            seg->next->prev = seg->prev;
         seg->prev->segment_size += seg->segment_size;
         seg = seg->prev;
     }
-    // try to coalesce segments to the right
+    // try to coalesce segments to the right, the size has to be taken before unlinking the neighbour
     while(seg->next != NULL && !seg->next->is_allocated) {
-        seg->next->next->prev = seg;
-        seg->next = seg->next->next;
         seg->segment_size += seg->next->segment_size;
+        if (seg->next->next != NULL)
+            seg->next->next->prev = seg;
+        seg->next = seg->next->next;
+    }
+}
+
+void mem_register_reclaimer(reclaimer_t *reclaimer) {
+    append_reclaimer_list(&reclaimers, reclaimer);
+}
+
+void mem_unregister_reclaimer(reclaimer_t *reclaimer) {
+    // not in the list(never registered or already removed), removing it would wipe the list head
+    if (reclaimer->prevreclaimer == NULL && reclaimers.head != reclaimer)
+        return;
+    remove_reclaimer_list(&reclaimers, reclaimer);
+}
+
+void mem_set_watermarks(uint32_t low, uint32_t high) {
+    low_watermark = low;
+    high_watermark = high < low ? low : high;
+    check_watermark();
+}
+
+uint32_t mem_free_pages(void) {
+    return size_page_list(&free_pages);
+}
+
+// give every reclaimer one chance, in registration order, until pages_wanted pages came back. Returns the pages freed
+static uint32_t reclaim_pass(uint32_t pages_wanted) {
+    reclaimer_t *reclaimer, *next;
+    uint32_t freed = 0;
+
+    if (reclaiming)
+        return 0;
+
+    reclaiming = 1;
+    for (reclaimer = peek_reclaimer_list(&reclaimers); reclaimer != NULL && freed < pages_wanted; reclaimer = next) {
+        // a reclaimer may unregister itself once it is empty, which clears its link
+        next = next_reclaimer_list(reclaimer);
+        freed += reclaimer->reclaim(pages_wanted - freed, reclaimer->data);
+    }
+    reclaiming = 0;
+
+    return freed;
+}
+
+// only flags the pressure, allocating must stay cheap
+static void check_watermark(void) {
+    if (size_page_list(&free_pages) < low_watermark)
+        reclaim_pending = 1;
+}
+
+// meant to be called whenever the kernel has nothing better to do
+void mem_reclaim_background(void) {
+    uint32_t free;
+
+    if (!reclaim_pending)
+        return;
+
+    // keep going while reclaimers make progress
+    while ((free = size_page_list(&free_pages)) < high_watermark) {
+        if (reclaim_pass(high_watermark - free) == 0)
+            break;
+    }
+    reclaim_pending = 0;
+}
+
+arena_t *arena_create(void) {
+    arena_chunk_t *chunk;
+    arena_t *arena;
+
+    chunk = alloc_page();
+    if (chunk == NULL)
+        return NULL;
+
+    // alloc_page() already zeroed the whole page
+    arena = (arena_t *)(chunk + 1);
+    arena->chunks = chunk;
+    arena->offset = sizeof(arena_chunk_t) + sizeof(arena_t);
+    arena->pages = arena->peak_pages = 1;
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, uint32_t size, uint32_t align) {
+    arena_chunk_t *chunk;
+    uint32_t start;
+
+    // default to the same 4 byte alignment as kmalloc, align must be a power of 2
+    if (align == 0)
+        align = 4;
+    if (align & (align - 1))
+        return NULL;
+
+    // the chunk header keeps page alignment from ever happening inside a chunk
+    if (align >= PAGE_SIZE)
+        return arena_alloc_large(arena, size, align);
+
+    // chunks are page aligned, so aligning the offset is enough to align the address
+    start = (arena->offset + align - 1) & ~(align - 1);
+    if (start > PAGE_SIZE || size > PAGE_SIZE - start) {
+        // doesn't fit in the current chunk, the rest of it is simply wasted
+        start = (sizeof(arena_chunk_t) + align - 1) & ~(align - 1);
+        if (size > PAGE_SIZE - start)
+            return arena_alloc_large(arena, size, align);
+
+        chunk = alloc_page();
+        if (chunk == NULL)
+            return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->offset = sizeof(arena_chunk_t);
+        if (++arena->pages > arena->peak_pages)
+            arena->peak_pages = arena->pages;
     }
+
+    arena->used += start - arena->offset + size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+    arena->offset = start + size;
+
+    return (void *)arena->chunks + start;
+}
+
+static void *arena_alloc_large(arena_t *arena, uint32_t size, uint32_t align) {
+    arena_large_t *large;
+    uint32_t pages;
+    void *base;
+
+    // keep the page count below from wrapping around
+    if (size > 0xFFFFFFFF - sizeof(arena_large_t) - PAGE_SIZE)
+        return NULL;
+
+    pages = (size + sizeof(arena_large_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    base = alloc_pages_contiguous(pages, align);
+    if (base == NULL)
+        return NULL;
+
+    large = base + pages * PAGE_SIZE - sizeof(arena_large_t);
+    large->base = base;
+    large->pages = pages;
+    large->next = arena->large;
+    arena->large = large;
+
+    arena->used += size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+    arena->pages += pages;
+    if (arena->pages > arena->peak_pages)
+        arena->peak_pages = arena->pages;
+
+    return base;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_chunk_t *first = (arena_chunk_t *)arena - 1;
+    arena_chunk_t *chunk;
+    arena_large_t *large;
+
+    // give back every chunk but the one holding the arena itself, O(chunks)
+    while (arena->chunks != first) {
+        chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free_page(chunk);
+    }
+    while (arena->large != NULL) {
+        large = arena->large;
+        arena->large = large->next;
+        free_pages_contiguous(large->base, large->pages);
+    }
+
+    // unlike fresh pages, reused memory is not zeroed again
+    arena->offset = sizeof(arena_chunk_t) + sizeof(arena_t);
+    arena->used = 0;
+    arena->pages = 1;
+}
+
+void arena_destroy(arena_t *arena) {
+    if (!arena)
+        return;
+
+    arena_reset(arena);
+    free_page((arena_chunk_t *)arena - 1);
+}
+
+uint32_t arena_high_water(arena_t *arena) {
+    return arena->high_water;
+}
+
+uint32_t arena_peak_pages(arena_t *arena) {
+    return arena->peak_pages;
 }
\ No newline at end of file